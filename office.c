@@ -51,6 +51,19 @@ void destroy_queue(struct queue *q) {
     free(q);
 }
 
+// Points every subordinate (and their own teams) back at the slot they now
+// live in. Subordinates are stored by value, so whenever a subordinates array
+// is reallocated or shifted the supervisor links below it go stale.
+static void relink_subordinates(struct employee* emp) {
+	for(size_t i = 0; i < emp->n_subordinates; i++){
+		struct employee* sub = &emp->subordinates[i];
+		sub->supervisor = emp;
+		for(size_t j = 0; j < sub->n_subordinates; j++){
+			sub->subordinates[j].supervisor = sub;
+		}
+	}
+}
+
 /**
  * Places an employee within the office, if the supervisor field is NULL
  *  it is assumed the employee will be placed under the next employee that is
@@ -132,6 +145,8 @@ void office_employee_place(struct office* off, struct employee* supervisor, stru
 					temp_node->subordinates[temp_node->n_subordinates - 1].name = malloc(sizeof(char) * 40);
 					strcpy(temp_node->subordinates[temp_node->n_subordinates - 1].name, emp->name);
 					temp_node->subordinates[temp_node->n_subordinates - 1].supervisor = supervisor;
+					// realloc may have moved the existing subordinates.
+					relink_subordinates(temp_node);
 					break;
 				}
 			}else {
@@ -153,8 +168,16 @@ void office_employee_place(struct office* off, struct employee* supervisor, stru
  * Fires an employee, removing from the office
  * If employee is null, nothing should occur
  * If the employee does not supervise anyone, they will just be removed
+ *  from their supervisor's team, the rest of the team keeps its order.
  * If the employee is supervising other employees, the first member of that 
- *  team will replace him.
+ *  team will replace him. The rest of the team stays, followed by the
+ *  replacement's own subordinates.
+ *
+ * Employees are stored by value in their supervisor's list, so pointers to
+ *  members of the team that changed are not valid afterwards.
+ * A department head who supervises no one cannot be fired this way and the
+ *  call does nothing. The caller has to free the head (and its name) and set
+ *  department_head to NULL itself.
  */
 void office_fire_employee(struct employee* employee) {
 	// Do nothing if emplyee is NULL
@@ -162,20 +185,51 @@ void office_fire_employee(struct employee* employee) {
 		return;
 	}
 	
-	if(employee != NULL){
-		// If employee does not have subordinates, then just free it.
-		if(employee->n_subordinates == 0){
-			free(employee->name);
-			employee->supervisor->n_subordinates--;
-			free(employee);
-			
-		// If employee has subordinates, delete the emplyee and replace with its first subordiantes.	
-		}else{
-			employee->n_subordinates--;
-			strcpy(employee->name, employee->subordinates[0].name);
-			free(employee->subordinates[0].name);
-			free(employee->subordinates);
+	// If employee does not have subordinates, remove it from its supervisor's list.
+	if(employee->n_subordinates == 0){
+		struct employee* supervisor = employee->supervisor;
+		// A lone department head has no list to be removed from.
+		if(supervisor == NULL){
+			return;
+		}
+		
+		size_t idx = employee - supervisor->subordinates;
+		free(employee->name);
+		// Close the gap left by the employee, keeping the order of the team.
+		memmove(&supervisor->subordinates[idx], &supervisor->subordinates[idx + 1],
+			sizeof(struct employee) * (supervisor->n_subordinates - idx - 1));
+		supervisor->n_subordinates--;
+		
+		if(supervisor->n_subordinates == 0){
+			free(supervisor->subordinates);
+			supervisor->subordinates = NULL;
+		}
+		relink_subordinates(supervisor);
+		
+	// If employee has subordinates, the first subordinate takes over the employee's place.
+	}else{
+		struct employee first = employee->subordinates[0];
+		size_t n_rest = employee->n_subordinates - 1;
+		size_t n_new = n_rest + first.n_subordinates;
+		struct employee* subordinates = NULL;
+		
+		strcpy(employee->name, first.name);
+		free(first.name);
+		
+		// The rest of the team stays in order, followed by the replacement's own team.
+		if(n_new > 0){
+			subordinates = (struct employee*)malloc(sizeof(struct employee) * n_new);
+			memcpy(subordinates, &employee->subordinates[1], sizeof(struct employee) * n_rest);
+			if(first.n_subordinates > 0){
+				memcpy(&subordinates[n_rest], first.subordinates, sizeof(struct employee) * first.n_subordinates);
+			}
 		}
+		
+		free(first.subordinates);
+		free(employee->subordinates);
+		employee->subordinates = subordinates;
+		employee->n_subordinates = n_new;
+		relink_subordinates(employee);
 	}
 }
 
@@ -486,6 +540,99 @@ void printLevelOrder(struct employee* emp) {
 	destroy_queue(q);
 } 
 
+// Tools that link office.c into their own program (e.g. office_server.c)
+// build with -DOFFICE_NO_MAIN.
+#ifndef OFFICE_NO_MAIN
+// Places an employee called name under the first employee called supervisor,
+// or by the default rule when supervisor is NULL.
+static void place_named(struct office* off, const char* supervisor, const char* name) {
+	struct employee emp = { .name = (char*)name, .supervisor = NULL, .subordinates = NULL, .n_subordinates = 0 };
+	struct employee* sup = NULL;
+	if(supervisor != NULL){
+		sup = office_get_first_employee_with_name(off, supervisor);
+	}
+	office_employee_place(off, sup, &emp);
+}
+
+// Checks that emp's team is exactly names (NULL terminated, in order) and that
+// every member and every member's own subordinates point at their supervisor.
+static int check_team(const char* what, struct employee* emp, const char** names) {
+	size_t n = 0;
+	while(names[n] != NULL){
+		n++;
+	}
+	
+	int ok = emp != NULL && emp->n_subordinates == n;
+	for(size_t i = 0; ok && i < n; i++){
+		struct employee* sub = &emp->subordinates[i];
+		ok = strcmp(sub->name, names[i]) == 0 && sub->supervisor == emp;
+		for(size_t j = 0; ok && j < sub->n_subordinates; j++){
+			ok = sub->subordinates[j].supervisor == sub;
+		}
+	}
+	printf("%s: %s\n", what, ok ? "ok" : "FAILED");
+	return ok ? 0 : 1;
+}
+
+// Testing for office_fire_employee and the supervisor links it has to keep.
+// Returns the number of failed checks.
+static int test_fire_employee() {
+	int failures = 0;
+	struct office* off = malloc(sizeof(struct office));
+	off->department_head = NULL;
+	
+	// Fire a leaf in the middle of a team, then a sibling found through the
+	// shifted team, then a subordinate of a shifted member.
+	place_named(off, NULL, "boss");
+	place_named(off, "boss", "a");
+	place_named(off, "boss", "b");
+	place_named(off, "boss", "c");
+	place_named(off, "boss", "d");
+	place_named(off, "d", "x");
+	office_fire_employee(office_get_first_employee_with_name(off, "b"));
+	failures += check_team("fire middle leaf", off->department_head, (const char*[]){ "a", "c", "d", NULL });
+	office_fire_employee(office_get_first_employee_with_name(off, "c"));
+	failures += check_team("fire shifted sibling", off->department_head, (const char*[]){ "a", "d", NULL });
+	office_fire_employee(office_get_first_employee_with_name(off, "x"));
+	failures += check_team("fire subordinate of shifted member",
+		office_get_first_employee_with_name(off, "d"), (const char*[]){ NULL });
+	office_disband(off);
+	
+	// Fire an employee whose replacement has a team of their own.
+	off = malloc(sizeof(struct office));
+	off->department_head = NULL;
+	place_named(off, NULL, "boss");
+	place_named(off, "boss", "m");
+	place_named(off, "m", "q");
+	place_named(off, "m", "t");
+	place_named(off, "q", "r");
+	place_named(off, "q", "s");
+	office_fire_employee(office_get_first_employee_with_name(off, "m"));
+	failures += check_team("replacement keeps position", off->department_head, (const char*[]){ "q", NULL });
+	failures += check_team("replacement merges teams",
+		office_get_first_employee_with_name(off, "q"), (const char*[]){ "t", "r", "s", NULL });
+	office_disband(off);
+	
+	// Grow a team until its array is reallocated, then fire a grandchild
+	// through its supervisor link.
+	off = malloc(sizeof(struct office));
+	off->department_head = NULL;
+	place_named(off, NULL, "boss");
+	place_named(off, "boss", "a");
+	place_named(off, "a", "g");
+	const char* team[] = { "a", "b", "c", "d", "e", "f", "h", "i", "j", "k", "l", NULL };
+	for(int i = 1; team[i] != NULL; i++){
+		place_named(off, "boss", team[i]);
+	}
+	failures += check_team("links after realloc", off->department_head, team);
+	office_fire_employee(office_get_first_employee_with_name(off, "g"));
+	failures += check_team("fire grandchild after realloc",
+		office_get_first_employee_with_name(off, "a"), (const char*[]){ NULL });
+	office_disband(off);
+	
+	return failures;
+}
+
 int main(){
 	// Allocate memory for office.
 	struct office* off = malloc(sizeof(struct office));
@@ -577,4 +724,7 @@ int main(){
 	printf("There are %ld employees matched with the name %s.\n", n_emps1, target_name);
 
 	office_disband(off);
+
+	return test_fire_employee() > 0;
 }
+#endif
@@ -0,0 +1,572 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "office_proto.h"
+
+/**
+ * office_loadgen drives an office_server and reports throughput and latency.
+ *
+ * Each connection runs on its own thread and keeps up to `depth` requests in
+ * flight: every round it tops the window up, sends the new requests in one
+ * write and then collects whatever responses have arrived. The latency of a
+ * request is the time from its write to the arrival of its response.
+ *
+ * Before the run the office is seeded with employees e0..e<n-1>, four to a
+ * supervisor, unless the server already holds e0.
+ *
+ * Build: gcc -O2 -o office_loadgen office_loadgen.c -pthread
+ */
+
+#define SEED_FANOUT 4
+#define MAX_LEVEL 6
+
+static const char* op_names[] = {
+	[OFFICE_OP_FIRST] = "first",
+	[OFFICE_OP_LAST] = "last",
+	[OFFICE_OP_BY_NAME] = "by_name",
+	[OFFICE_OP_AT_LEVEL] = "at_level",
+	[OFFICE_OP_POSTORDER] = "postorder",
+	[OFFICE_OP_PLACE] = "place",
+	[OFFICE_OP_FIRE] = "fire",
+};
+
+struct options {
+	const char* path;
+	int n_connections;
+	size_t n_requests; // per connection
+	size_t depth;
+	size_t n_employees;
+	int write_percent;
+	uint8_t read_ops[OFFICE_OP_POSTORDER]; // ops lookups are drawn from
+	size_t n_read_ops;
+};
+
+struct client {
+	int fd;
+	unsigned char* out;
+	size_t out_len;
+	unsigned char* in;
+	size_t in_len;
+	size_t in_cap;
+};
+
+struct worker {
+	pthread_t thread;
+	int id;
+	const struct options* opts;
+	uint64_t* latencies; // ns, one per request
+	uint8_t* ops; // op of each latency
+	size_t n_latencies;
+	size_t n_status[3];
+	size_t n_out_of_order; // responses whose id was not the next request's
+	int failed;
+};
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int client_connect(struct client* cl, const char* path, size_t depth) {
+	struct sockaddr_un addr;
+	memset(cl, 0, sizeof(*cl));
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+	cl->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(cl->fd < 0 || connect(cl->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0){
+		perror("office_loadgen: connect");
+		return -1;
+	}
+	cl->out = malloc(OFFICE_REQUEST_MAX * depth);
+	cl->in_cap = 64 * 1024;
+	cl->in = malloc(cl->in_cap);
+	return 0;
+}
+
+static void client_close(struct client* cl) {
+	if(cl->fd >= 0){
+		close(cl->fd);
+	}
+	free(cl->out);
+	free(cl->in);
+}
+
+static void put_name(struct client* cl, const char* name) {
+	size_t n = strlen(name);
+	cl->out[cl->out_len++] = (unsigned char)n;
+	memcpy(cl->out + cl->out_len, name, n);
+	cl->out_len += n;
+}
+
+// Starts a request frame, finish it with end_request.
+static size_t begin_request(struct client* cl, uint32_t id, uint8_t op) {
+	size_t start = cl->out_len;
+	office_put_u32(cl->out + start + 4, id);
+	cl->out[start + 8] = op;
+	cl->out_len += 9;
+	return start;
+}
+
+static void end_request(struct client* cl, size_t start) {
+	office_put_u32(cl->out + start, (uint32_t)(cl->out_len - start - 4));
+}
+
+static void request_name(struct client* cl, uint32_t id, uint8_t op, const char* name) {
+	size_t start = begin_request(cl, id, op);
+	put_name(cl, name);
+	end_request(cl, start);
+}
+
+static void request_place(struct client* cl, uint32_t id, const char* supervisor, const char* name) {
+	size_t start = begin_request(cl, id, OFFICE_OP_PLACE);
+	put_name(cl, supervisor);
+	put_name(cl, name);
+	end_request(cl, start);
+}
+
+static void request_level(struct client* cl, uint32_t id, uint32_t level) {
+	size_t start = begin_request(cl, id, OFFICE_OP_AT_LEVEL);
+	office_put_u32(cl->out + cl->out_len, level);
+	cl->out_len += 4;
+	end_request(cl, start);
+}
+
+static int client_send(struct client* cl) {
+	size_t off = 0;
+	while(off < cl->out_len){
+		ssize_t n = send(cl->fd, cl->out + off, cl->out_len - off, MSG_NOSIGNAL);
+		if(n < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			perror("office_loadgen: send");
+			return -1;
+		}
+		off += (size_t)n;
+	}
+	cl->out_len = 0;
+	return 0;
+}
+
+// Returns up to max complete responses, their ids and status bytes through ids
+// and status. Responses already buffered are used first, the socket is only
+// read (and blocked on) while none is complete.
+static int client_receive(struct client* cl, uint32_t* ids, uint8_t* status, size_t max,
+	size_t* n_done) {
+	*n_done = 0;
+	for(;;){
+		size_t off = 0;
+		while(*n_done < max && cl->in_len - off >= 4){
+			uint32_t len = office_get_u32(cl->in + off);
+			if(cl->in_len - off - 4 < len){
+				break;
+			}
+			ids[*n_done] = office_get_u32(cl->in + off + 4);
+			status[(*n_done)++] = cl->in[off + 8];
+			off += 4 + len;
+		}
+		memmove(cl->in, cl->in + off, cl->in_len - off);
+		cl->in_len -= off;
+		if(*n_done > 0){
+			return 0;
+		}
+
+		if(cl->in_len == cl->in_cap){
+			cl->in_cap *= 2;
+			cl->in = realloc(cl->in, cl->in_cap);
+		}
+		ssize_t n = recv(cl->fd, cl->in + cl->in_len, cl->in_cap - cl->in_len, 0);
+		if(n < 0 && errno == EINTR){
+			continue;
+		}
+		if(n <= 0){
+			fprintf(stderr, "office_loadgen: server closed the connection\n");
+			return -1;
+		}
+		cl->in_len += (size_t)n;
+	}
+}
+
+// Sends what has been queued (ids first_id onwards) and waits for every
+// response. Responses must come back in request order.
+static int client_round_trip(struct client* cl, uint32_t first_id, size_t n_requests,
+	size_t* n_failed) {
+	uint32_t ids[256];
+	uint8_t status[256];
+	if(client_send(cl) < 0){
+		return -1;
+	}
+	while(n_requests > 0){
+		size_t n_done;
+		size_t max = n_requests < sizeof(status) ? n_requests : sizeof(status);
+		if(client_receive(cl, ids, status, max, &n_done) < 0){
+			return -1;
+		}
+		for(size_t i = 0; i < n_done; i++){
+			if(ids[i] != first_id){
+				fprintf(stderr, "office_loadgen: response %u arrived for request %u\n", ids[i], first_id);
+				return -1;
+			}
+			if(status[i] != OFFICE_STATUS_OK){
+				(*n_failed)++;
+			}
+			first_id++;
+		}
+		n_requests -= n_done;
+	}
+	return 0;
+}
+
+static int seed_office(const struct options* opts) {
+	struct client cl;
+	char name[OFFICE_NAME_MAX + 1];
+	char supervisor[OFFICE_NAME_MAX + 1];
+	size_t n_failed = 0;
+
+	if(opts->n_employees == 0){
+		return 0;
+	}
+	if(client_connect(&cl, opts->path, opts->depth) < 0){
+		client_close(&cl);
+		return -1;
+	}
+
+	request_name(&cl, 0, OFFICE_OP_FIRST, "e0");
+	if(client_round_trip(&cl, 0, 1, &n_failed) < 0){
+		client_close(&cl);
+		return -1;
+	}
+	if(n_failed == 0){
+		printf("office already holds e0, skipping seeding\n");
+		client_close(&cl);
+		return 0;
+	}
+
+	n_failed = 0;
+	size_t queued = 0;
+	for(size_t i = 0; i < opts->n_employees; i++){
+		snprintf(name, sizeof(name), "e%zu", i);
+		supervisor[0] = '\0';
+		if(i > 0){
+			snprintf(supervisor, sizeof(supervisor), "e%zu", (i - 1) / SEED_FANOUT);
+		}
+		request_place(&cl, (uint32_t)i, supervisor, name);
+		queued++;
+		if(queued == opts->depth || i + 1 == opts->n_employees){
+			if(client_round_trip(&cl, (uint32_t)(i + 1 - queued), queued, &n_failed) < 0){
+				client_close(&cl);
+				return -1;
+			}
+			queued = 0;
+		}
+	}
+	client_close(&cl);
+
+	if(n_failed > 0){
+		fprintf(stderr, "office_loadgen: %zu employees could not be placed\n", n_failed);
+		return -1;
+	}
+	printf("seeded %zu employees\n", opts->n_employees);
+	return 0;
+}
+
+// Queues one request of the mix: lookups drawn evenly from read_ops, and
+// write_percent place/fire pairs.
+// Returns the op queued.
+static uint8_t queue_request(struct worker* w, struct client* cl, uint32_t id,
+	unsigned int* seed, int* placed) {
+	const struct options* opts = w->opts;
+	char name[OFFICE_NAME_MAX + 1];
+
+	if((int)(rand_r(seed) % 100) < opts->write_percent){
+		snprintf(name, sizeof(name), "t%d", w->id);
+		uint8_t op = *placed ? OFFICE_OP_FIRE : OFFICE_OP_PLACE;
+		if(*placed){
+			request_name(cl, id, op, name);
+		}else{
+			request_place(cl, id, "", name);
+		}
+		*placed = !*placed;
+		return op;
+	}
+
+	size_t n_names = opts->n_employees > 0 ? opts->n_employees : 1;
+	snprintf(name, sizeof(name), "e%u", rand_r(seed) % (unsigned int)n_names);
+	uint8_t op = opts->read_ops[rand_r(seed) % opts->n_read_ops];
+	switch(op){
+	case OFFICE_OP_AT_LEVEL:
+		request_level(cl, id, rand_r(seed) % MAX_LEVEL);
+		break;
+	case OFFICE_OP_POSTORDER:
+		end_request(cl, begin_request(cl, id, op));
+		break;
+	default:
+		request_name(cl, id, op, name);
+		break;
+	}
+	return op;
+}
+
+// Parses the -r argument, one letter per read op.
+static int parse_read_ops(struct options* opts, const char* letters) {
+	const char* known = "flnap";
+	opts->n_read_ops = 0;
+	for(const char* p = letters; *p != '\0'; p++){
+		const char* found = strchr(known, *p);
+		if(found == NULL || opts->n_read_ops == sizeof(opts->read_ops)){
+			return -1;
+		}
+		opts->read_ops[opts->n_read_ops++] = (uint8_t)(OFFICE_OP_FIRST + (found - known));
+	}
+	return opts->n_read_ops > 0 ? 0 : -1;
+}
+
+static void* worker_main(void* arg) {
+	struct worker* w = arg;
+	const struct options* opts = w->opts;
+	struct client cl;
+	unsigned int seed = (unsigned int)(w->id * 7919 + 1);
+	int placed = 0;
+
+	uint64_t* sent_at = malloc(sizeof(uint64_t) * opts->depth);
+	uint8_t* sent_op = malloc(opts->depth);
+	uint8_t* status = malloc(opts->depth);
+	uint32_t* ids = malloc(sizeof(uint32_t) * opts->depth);
+	w->latencies = malloc(sizeof(uint64_t) * opts->n_requests);
+	w->ops = malloc(opts->n_requests);
+
+	if(client_connect(&cl, opts->path, opts->depth) < 0){
+		w->failed = 1;
+		client_close(&cl);
+		free(sent_at);
+		free(sent_op);
+		free(status);
+		free(ids);
+		return NULL;
+	}
+
+	size_t n_sent = 0;
+	size_t n_received = 0;
+	while(n_received < opts->n_requests){
+		// Top the window up and send the new requests in one write.
+		size_t first = n_sent;
+		while(n_sent - n_received < opts->depth && n_sent < opts->n_requests){
+			sent_op[n_sent % opts->depth] = queue_request(w, &cl, (uint32_t)n_sent, &seed, &placed);
+			n_sent++;
+		}
+		if(n_sent > first){
+			uint64_t t = now_ns();
+			for(size_t i = first; i < n_sent; i++){
+				sent_at[i % opts->depth] = t;
+			}
+			if(client_send(&cl) < 0){
+				w->failed = 1;
+				break;
+			}
+		}
+
+		size_t n_done;
+		if(client_receive(&cl, ids, status, n_sent - n_received, &n_done) < 0){
+			w->failed = 1;
+			break;
+		}
+		uint64_t t = now_ns();
+		for(size_t i = 0; i < n_done; i++){
+			w->ops[w->n_latencies] = sent_op[n_received % opts->depth];
+			w->latencies[w->n_latencies++] = t - sent_at[n_received % opts->depth];
+			if(status[i] < 3){
+				w->n_status[status[i]]++;
+			}
+			if(ids[i] != (uint32_t)n_received){
+				w->n_out_of_order++;
+			}
+			n_received++;
+		}
+	}
+
+	client_close(&cl);
+	free(sent_at);
+	free(sent_op);
+	free(status);
+	free(ids);
+	return NULL;
+}
+
+static int compare_u64(const void* a, const void* b) {
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+static double percentile_us(const uint64_t* sorted, size_t n, double p) {
+	size_t idx = (size_t)(p * (double)(n - 1));
+	return (double)sorted[idx] / 1000.0;
+}
+
+// Sorts latencies in place and prints one summary line.
+static void print_latency(const char* label, uint64_t* latencies, size_t n) {
+	if(n == 0){
+		return;
+	}
+	qsort(latencies, n, sizeof(uint64_t), compare_u64);
+	printf("%-11s n %zu, p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f us\n", label, n,
+		percentile_us(latencies, n, 0.50), percentile_us(latencies, n, 0.90),
+		percentile_us(latencies, n, 0.99), percentile_us(latencies, n, 0.999),
+		(double)latencies[n - 1] / 1000.0);
+}
+
+// Collects the latencies of the ops for which include[op] is set.
+static size_t select_latencies(const uint64_t* latencies, const uint8_t* ops, size_t n,
+	const int* include, uint64_t* selected) {
+	size_t n_selected = 0;
+	for(size_t i = 0; i < n; i++){
+		if(include[ops[i]]){
+			selected[n_selected++] = latencies[i];
+		}
+	}
+	return n_selected;
+}
+
+static void usage(const char* prog) {
+	fprintf(stderr, "usage: %s [-s socket_path] [-c connections] [-n requests_per_connection]\n"
+		"          [-d pipeline_depth] [-e seed_employees] [-w write_percent] [-r read_ops]\n"
+		"read_ops: f first, l last, n by name, a at level, p postorder (default flnap)\n", prog);
+}
+
+int main(int argc, char** argv) {
+	struct options opts = {
+		.path = OFFICE_SOCKET_PATH,
+		.n_connections = 4,
+		.n_requests = 100000,
+		.depth = 32,
+		.n_employees = 1000,
+		.write_percent = 0,
+	};
+	int opt;
+
+	parse_read_ops(&opts, "flnap");
+	while((opt = getopt(argc, argv, "s:c:n:d:e:w:r:h")) != -1){
+		switch(opt){
+		case 's':
+			opts.path = optarg;
+			break;
+		case 'c':
+			opts.n_connections = atoi(optarg);
+			break;
+		case 'n':
+			opts.n_requests = strtoul(optarg, NULL, 10);
+			break;
+		case 'd':
+			opts.depth = strtoul(optarg, NULL, 10);
+			break;
+		case 'e':
+			opts.n_employees = strtoul(optarg, NULL, 10);
+			break;
+		case 'w':
+			opts.write_percent = atoi(optarg);
+			break;
+		case 'r':
+			if(parse_read_ops(&opts, optarg) < 0){
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if(opts.n_connections < 1 || opts.n_requests == 0 || opts.depth == 0){
+		usage(argv[0]);
+		return 1;
+	}
+
+	if(seed_office(&opts) < 0){
+		return 1;
+	}
+
+	struct worker* workers = calloc(opts.n_connections, sizeof(struct worker));
+	uint64_t start = now_ns();
+	for(int i = 0; i < opts.n_connections; i++){
+		workers[i].id = i;
+		workers[i].opts = &opts;
+		pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+	}
+
+	size_t n_total = 0;
+	size_t n_status[3] = { 0, 0, 0 };
+	size_t n_out_of_order = 0;
+	int failed = 0;
+	for(int i = 0; i < opts.n_connections; i++){
+		pthread_join(workers[i].thread, NULL);
+		n_total += workers[i].n_latencies;
+		for(int s = 0; s < 3; s++){
+			n_status[s] += workers[i].n_status[s];
+		}
+		n_out_of_order += workers[i].n_out_of_order;
+		failed |= workers[i].failed;
+	}
+	double elapsed = (double)(now_ns() - start) / 1e9;
+
+	uint64_t* latencies = malloc(sizeof(uint64_t) * (n_total > 0 ? n_total : 1));
+	uint8_t* ops = malloc(n_total > 0 ? n_total : 1);
+	uint64_t* selected = malloc(sizeof(uint64_t) * (n_total > 0 ? n_total : 1));
+	size_t off = 0;
+	for(int i = 0; i < opts.n_connections; i++){
+		memcpy(latencies + off, workers[i].latencies, sizeof(uint64_t) * workers[i].n_latencies);
+		memcpy(ops + off, workers[i].ops, workers[i].n_latencies);
+		off += workers[i].n_latencies;
+		free(workers[i].latencies);
+		free(workers[i].ops);
+	}
+	free(workers);
+
+	printf("connections %d, depth %zu, writes %d%%, read ops", opts.n_connections, opts.depth,
+		opts.write_percent);
+	for(size_t i = 0; i < opts.n_read_ops; i++){
+		printf(" %s", op_names[opts.read_ops[i]]);
+	}
+	printf("\n");
+	printf("requests    %zu in %.3f s (%.0f req/s)\n", n_total, elapsed, (double)n_total / elapsed);
+	printf("status      ok %zu, not found %zu, bad request %zu\n", n_status[OFFICE_STATUS_OK],
+		n_status[OFFICE_STATUS_NOT_FOUND], n_status[OFFICE_STATUS_BAD_REQUEST]);
+	printf("order       %zu responses out of order\n", n_out_of_order);
+
+	// Reads and writes are reported apart so writers waiting on the office
+	// lock show up in their own tail.
+	int include[OFFICE_OP_FIRE + 1];
+	char label[32];
+	int first_op[] = { OFFICE_OP_FIRST, OFFICE_OP_PLACE };
+	int last_op[] = { OFFICE_OP_POSTORDER, OFFICE_OP_FIRE };
+	const char* group[] = { "reads", "writes" };
+	for(int g = 0; g < 2; g++){
+		memset(include, 0, sizeof(include));
+		for(int op = first_op[g]; op <= last_op[g]; op++){
+			include[op] = 1;
+		}
+		print_latency(group[g], selected, select_latencies(latencies, ops, n_total, include, selected));
+		for(int op = first_op[g]; op <= last_op[g]; op++){
+			memset(include, 0, sizeof(include));
+			include[op] = 1;
+			snprintf(label, sizeof(label), "  %s", op_names[op]);
+			print_latency(label, selected, select_latencies(latencies, ops, n_total, include, selected));
+		}
+	}
+	print_latency("all", latencies, n_total);
+	free(selected);
+	free(ops);
+	free(latencies);
+	return failed || n_out_of_order > 0 ? 1 : 0;
+}
@@ -0,0 +1,65 @@
+#ifndef SRC_OFFICE_PROTO_H_
+#define SRC_OFFICE_PROTO_H_
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Wire protocol shared by office_server and its clients.
+ *
+ * Every message is a frame: a 4 byte length (bytes that follow it), then a
+ * 4 byte request id chosen by the client. All integers are big-endian and
+ * names are sent as a 1 byte length followed by the bytes (no terminator).
+ *
+ * Request:  [len u32][id u32][op u8][body]
+ *   OFFICE_OP_FIRST, OFFICE_OP_LAST, OFFICE_OP_BY_NAME, OFFICE_OP_FIRE: name
+ *   OFFICE_OP_AT_LEVEL:  level u32
+ *   OFFICE_OP_POSTORDER: (empty)
+ *   OFFICE_OP_PLACE:     supervisor name (length 0 for NULL), name
+ * Employee names may not be empty. A request with an unknown op, a bad name
+ * or bytes after its body is answered with OFFICE_STATUS_BAD_REQUEST.
+ *
+ * Response: [len u32][id u32][status u8][count u32]
+ *   followed by count entries of [name][n_subordinates u32]
+ *
+ * Clients may pipeline as many requests as they like on one connection,
+ * responses always come back in the order the requests were sent.
+ */
+
+#define OFFICE_SOCKET_PATH "/tmp/office.sock"
+
+// Names are stored in 40 byte buffers by office.c.
+#define OFFICE_NAME_MAX 39
+
+#define OFFICE_FRAME_HEADER 8
+// Largest request body: op + two names.
+#define OFFICE_REQUEST_MAX (OFFICE_FRAME_HEADER + 1 + 2 * (1 + OFFICE_NAME_MAX))
+
+enum office_op {
+	OFFICE_OP_FIRST = 1,
+	OFFICE_OP_LAST,
+	OFFICE_OP_BY_NAME,
+	OFFICE_OP_AT_LEVEL,
+	OFFICE_OP_POSTORDER,
+	OFFICE_OP_PLACE,
+	OFFICE_OP_FIRE,
+};
+
+enum office_status {
+	OFFICE_STATUS_OK = 0,
+	OFFICE_STATUS_NOT_FOUND,
+	OFFICE_STATUS_BAD_REQUEST,
+};
+
+static inline void office_put_u32(unsigned char* p, uint32_t v) {
+	p[0] = (unsigned char)(v >> 24);
+	p[1] = (unsigned char)(v >> 16);
+	p[2] = (unsigned char)(v >> 8);
+	p[3] = (unsigned char)v;
+}
+
+static inline uint32_t office_get_u32(const unsigned char* p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+		((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+#endif
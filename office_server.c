@@ -0,0 +1,786 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "office.h"
+#include "office_proto.h"
+
+/**
+ * office_server keeps one office in memory and answers queries and mutations
+ * over a UNIX domain socket (see office_proto.h for the wire format).
+ *
+ * A single event loop owns every connection. Whenever a connection has whole
+ * request frames buffered, a run of up to BATCH_MAX of them is handed to the
+ * worker pool as one job. A batch holds either only queries or only place/fire
+ * requests. Workers run a batch under one acquisition of the office lock
+ * (shared for queries, exclusive for mutations, with waiting writers served
+ * first) and hand the encoded responses back to the loop, which writes them
+ * out.
+ * A connection only has one batch in flight, so responses stay in order.
+ *
+ * Build: gcc -O2 -DOFFICE_NO_MAIN -o office_server office_server.c office.c -pthread
+ */
+
+// Most requests of one connection handed to a worker at a time.
+#define BATCH_MAX 256
+// Stop reading from / dispatching for a connection past this much buffered data.
+#define HIGH_WATER (1 << 20)
+#define READ_CHUNK (16 * 1024)
+#define MAX_EVENTS 64
+
+struct buffer {
+	unsigned char* data;
+	size_t len;
+	size_t cap;
+};
+
+struct connection {
+	int fd; // -1 once closed
+	uint32_t events; // epoll interest currently registered
+	struct buffer in;
+	size_t in_off; // bytes of in already handed to the workers
+	struct buffer out;
+	size_t out_off; // bytes of out already written
+	int busy; // a batch is with the workers
+	int eof; // the peer will send no more requests
+	struct connection* prev;
+	struct connection* next;
+};
+
+struct job {
+	struct connection* conn;
+	struct buffer requests; // whole request frames
+	int has_mutation;
+	struct buffer responses;
+	struct job* next;
+};
+
+struct job_list {
+	struct job* head;
+	struct job* tail;
+};
+
+struct server {
+	struct office* off;
+	pthread_rwlock_t office_lock;
+
+	pthread_mutex_t pending_mutex;
+	pthread_cond_t pending_cond;
+	struct job_list pending;
+	int stopping;
+
+	pthread_mutex_t done_mutex;
+	struct job_list done;
+
+	int epoll_fd;
+	int wake_fd[2];
+	struct connection* connections;
+	struct connection* closed;
+};
+
+static struct server server;
+static volatile sig_atomic_t stop_requested = 0;
+
+// epoll tags for the two descriptors that are not connections.
+static char listen_tag;
+static char wake_tag;
+
+// Buffer helpers
+static void buffer_reserve(struct buffer* b, size_t extra) {
+	if(b->len + extra <= b->cap){
+		return;
+	}
+	size_t cap = b->cap > 0 ? b->cap : 4096;
+	while(cap < b->len + extra){
+		cap *= 2;
+	}
+	b->data = realloc(b->data, cap);
+	b->cap = cap;
+}
+
+static void buffer_append(struct buffer* b, const void* data, size_t n) {
+	buffer_reserve(b, n);
+	memcpy(b->data + b->len, data, n);
+	b->len += n;
+}
+
+static void buffer_put_u32(struct buffer* b, uint32_t v) {
+	buffer_reserve(b, 4);
+	office_put_u32(b->data + b->len, v);
+	b->len += 4;
+}
+
+static void buffer_put_u8(struct buffer* b, uint8_t v) {
+	buffer_append(b, &v, 1);
+}
+
+// Drop the first n bytes.
+static void buffer_consume(struct buffer* b, size_t n) {
+	memmove(b->data, b->data + n, b->len - n);
+	b->len -= n;
+}
+
+// Drops the first off bytes once they are at least half of the buffer, so
+// the unconsumed tail is moved rarely and the buffer stops growing.
+static void buffer_compact(struct buffer* b, size_t* off) {
+	if(*off == b->len){
+		b->len = 0;
+		*off = 0;
+	}else if(*off >= b->cap / 2){
+		buffer_consume(b, *off);
+		*off = 0;
+	}
+}
+
+static void buffer_free(struct buffer* b) {
+	free(b->data);
+	b->data = NULL;
+	b->len = 0;
+	b->cap = 0;
+}
+
+static void job_list_push(struct job_list* list, struct job* job) {
+	job->next = NULL;
+	if(list->tail == NULL){
+		list->head = job;
+	}else{
+		list->tail->next = job;
+	}
+	list->tail = job;
+}
+
+static void job_free(struct job* job) {
+	buffer_free(&job->requests);
+	buffer_free(&job->responses);
+	free(job);
+}
+
+// Request handling, runs on the workers with the office lock held.
+
+// Reads a length prefixed name into name (OFFICE_NAME_MAX + 1 bytes).
+static int read_name(const unsigned char** p, const unsigned char* end, char* name) {
+	if(*p >= end){
+		return -1;
+	}
+	size_t n = **p;
+	(*p)++;
+	if(n > OFFICE_NAME_MAX || (size_t)(end - *p) < n){
+		return -1;
+	}
+	memcpy(name, *p, n);
+	name[n] = '\0';
+	*p += n;
+	return (int)n;
+}
+
+static void put_employee(struct buffer* out, const struct employee* emp) {
+	size_t n = strlen(emp->name);
+	buffer_put_u8(out, (uint8_t)n);
+	buffer_append(out, emp->name, n);
+	buffer_put_u32(out, (uint32_t)emp->n_subordinates);
+}
+
+// Encodes a query result and frees it.
+static uint32_t put_employees(struct buffer* out, struct employee* emplys, size_t n_employees) {
+	for(size_t i = 0; i < n_employees; i++){
+		put_employee(out, &emplys[i]);
+		free(emplys[i].name);
+	}
+	free(emplys);
+	return (uint32_t)n_employees;
+}
+
+// The office.c queries expect a department head to exist.
+static struct employee* find_employee(struct office* off, const char* name, uint8_t op) {
+	if(off->department_head == NULL){
+		return NULL;
+	}
+	if(op == OFFICE_OP_LAST){
+		return office_get_last_employee_with_name(off, name);
+	}
+	return office_get_first_employee_with_name(off, name);
+}
+
+static int fire_employee(struct office* off, const char* name) {
+	struct employee* emp = find_employee(off, name, OFFICE_OP_FIRST);
+	if(emp == NULL){
+		return -1;
+	}
+
+	// office_fire_employee leaves a department head that works alone to us.
+	if(emp == off->department_head && emp->n_subordinates == 0){
+		free(emp->name);
+		free(emp);
+		off->department_head = NULL;
+		return 0;
+	}
+
+	office_fire_employee(emp);
+	return 0;
+}
+
+// Reads the body of a request of kind op into supervisor_name, name and level.
+// Returns -1 for an unknown op, a missing or empty employee name, or bytes
+// left over after the body.
+static int parse_request(uint8_t op, const unsigned char* p, const unsigned char* end,
+	char* supervisor_name, char* name, uint32_t* level) {
+	switch(op){
+	case OFFICE_OP_FIRST:
+	case OFFICE_OP_LAST:
+	case OFFICE_OP_BY_NAME:
+	case OFFICE_OP_FIRE:
+		if(read_name(&p, end, name) <= 0){
+			return -1;
+		}
+		break;
+	case OFFICE_OP_AT_LEVEL:
+		if(end - p < 4){
+			return -1;
+		}
+		*level = office_get_u32(p);
+		p += 4;
+		break;
+	case OFFICE_OP_POSTORDER:
+		break;
+	case OFFICE_OP_PLACE:
+		// An empty supervisor name stands for NULL, the employee needs a name.
+		if(read_name(&p, end, supervisor_name) < 0 || read_name(&p, end, name) <= 0){
+			return -1;
+		}
+		break;
+	default:
+		return -1;
+	}
+	return p == end ? 0 : -1;
+}
+
+// Handles one request frame (starting at the id) and appends its response.
+static void handle_request(struct office* off, const unsigned char* p, size_t len,
+	struct buffer* out) {
+	const unsigned char* end = p + len;
+	uint32_t id = office_get_u32(p);
+	uint8_t op = p[4];
+	p += 5;
+
+	char name[OFFICE_NAME_MAX + 1];
+	char supervisor_name[OFFICE_NAME_MAX + 1];
+	uint32_t level = 0;
+	struct employee* emplys = NULL;
+	size_t n_emps = 0;
+	uint8_t status = OFFICE_STATUS_OK;
+	uint32_t count = 0;
+
+	// Length, status and count are patched in once the body is known.
+	size_t start = out->len;
+	buffer_put_u32(out, 0);
+	buffer_put_u32(out, id);
+	buffer_put_u8(out, 0);
+	buffer_put_u32(out, 0);
+
+	if(parse_request(op, p, end, supervisor_name, name, &level) < 0){
+		status = OFFICE_STATUS_BAD_REQUEST;
+	}else{
+		switch(op){
+		case OFFICE_OP_FIRST:
+		case OFFICE_OP_LAST: {
+			struct employee* emp = find_employee(off, name, op);
+			if(emp == NULL){
+				status = OFFICE_STATUS_NOT_FOUND;
+				break;
+			}
+			put_employee(out, emp);
+			count = 1;
+			break;
+		}
+		case OFFICE_OP_BY_NAME:
+			if(off->department_head != NULL){
+				office_get_employees_by_name(off, name, &emplys, &n_emps);
+			}
+			count = put_employees(out, emplys, n_emps);
+			break;
+		case OFFICE_OP_AT_LEVEL:
+			if(off->department_head != NULL){
+				office_get_employees_at_level(off, level, &emplys, &n_emps);
+			}
+			count = put_employees(out, emplys, n_emps);
+			break;
+		case OFFICE_OP_POSTORDER:
+			if(off->department_head != NULL){
+				office_get_employees_postorder(off, &emplys, &n_emps);
+			}
+			count = put_employees(out, emplys, n_emps);
+			break;
+		case OFFICE_OP_PLACE: {
+			struct employee* supervisor = NULL;
+			if(supervisor_name[0] != '\0'){
+				supervisor = find_employee(off, supervisor_name, OFFICE_OP_FIRST);
+				if(supervisor == NULL){
+					status = OFFICE_STATUS_NOT_FOUND;
+					break;
+				}
+			}
+			struct employee emp = { .name = name, .supervisor = NULL, .subordinates = NULL, .n_subordinates = 0 };
+			office_employee_place(off, supervisor, &emp);
+			break;
+		}
+		case OFFICE_OP_FIRE:
+			if(fire_employee(off, name) < 0){
+				status = OFFICE_STATUS_NOT_FOUND;
+			}
+			break;
+		}
+	}
+
+	office_put_u32(out->data + start, (uint32_t)(out->len - start - 4));
+	out->data[start + 8] = status;
+	office_put_u32(out->data + start + 9, count);
+}
+
+static void run_job(struct job* job) {
+	// One lock acquisition covers the whole batch.
+	if(job->has_mutation){
+		pthread_rwlock_wrlock(&server.office_lock);
+	}else{
+		pthread_rwlock_rdlock(&server.office_lock);
+	}
+
+	size_t off = 0;
+	while(off < job->requests.len){
+		uint32_t len = office_get_u32(job->requests.data + off);
+		handle_request(server.off, job->requests.data + off + 4, len, &job->responses);
+		off += 4 + len;
+	}
+
+	pthread_rwlock_unlock(&server.office_lock);
+}
+
+static void wake_loop(void) {
+	char c = 0;
+	// A full pipe already guarantees a wakeup.
+	if(write(server.wake_fd[1], &c, 1) < 0 && errno != EAGAIN){
+		perror("office_server: write");
+	}
+}
+
+static void* worker_main(void* arg) {
+	(void)arg;
+	for(;;){
+		pthread_mutex_lock(&server.pending_mutex);
+		while(server.pending.head == NULL && !server.stopping){
+			pthread_cond_wait(&server.pending_cond, &server.pending_mutex);
+		}
+		struct job* job = server.pending.head;
+		if(job == NULL){
+			pthread_mutex_unlock(&server.pending_mutex);
+			break;
+		}
+		server.pending.head = job->next;
+		if(server.pending.head == NULL){
+			server.pending.tail = NULL;
+		}
+		pthread_mutex_unlock(&server.pending_mutex);
+
+		run_job(job);
+
+		pthread_mutex_lock(&server.done_mutex);
+		job_list_push(&server.done, job);
+		pthread_mutex_unlock(&server.done_mutex);
+		wake_loop();
+	}
+	return NULL;
+}
+
+// Connection handling, everything below runs on the event loop.
+
+static void connection_update(struct connection* c) {
+	uint32_t events = 0;
+	if(!c->eof && c->in.len - c->in_off < HIGH_WATER){
+		events |= EPOLLIN | EPOLLRDHUP;
+	}
+	if(c->out_off < c->out.len){
+		events |= EPOLLOUT;
+	}
+	if(events == c->events){
+		return;
+	}
+	struct epoll_event ev = { .events = events, .data.ptr = c };
+	epoll_ctl(server.epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+	c->events = events;
+}
+
+static void connection_close(struct connection* c) {
+	epoll_ctl(server.epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	c->fd = -1;
+
+	if(c->prev != NULL){
+		c->prev->next = c->next;
+	}else{
+		server.connections = c->next;
+	}
+	if(c->next != NULL){
+		c->next->prev = c->prev;
+	}
+
+	// Freed at the end of the loop iteration, or once its batch comes back.
+	c->prev = NULL;
+	c->next = NULL;
+	if(!c->busy){
+		c->next = server.closed;
+		server.closed = c;
+	}
+}
+
+static void connection_free(struct connection* c) {
+	buffer_free(&c->in);
+	buffer_free(&c->out);
+	free(c);
+}
+
+// Returns -1 on a read error, end of input only sets c->eof.
+static int connection_read(struct connection* c) {
+	while(c->in.len - c->in_off < HIGH_WATER){
+		buffer_compact(&c->in, &c->in_off);
+		buffer_reserve(&c->in, READ_CHUNK);
+		ssize_t n = read(c->fd, c->in.data + c->in.len, c->in.cap - c->in.len);
+		if(n > 0){
+			c->in.len += (size_t)n;
+		}else if(n == 0){
+			c->eof = 1;
+			break;
+		}else if(errno == EINTR){
+			continue;
+		}else if(errno == EAGAIN || errno == EWOULDBLOCK){
+			break;
+		}else{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int connection_flush(struct connection* c) {
+	while(c->out_off < c->out.len){
+		ssize_t n = send(c->fd, c->out.data + c->out_off, c->out.len - c->out_off, MSG_NOSIGNAL);
+		if(n > 0){
+			c->out_off += (size_t)n;
+		}else if(n < 0 && errno == EINTR){
+			continue;
+		}else if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+			break;
+		}else{
+			return -1;
+		}
+	}
+	buffer_compact(&c->out, &c->out_off);
+	return 0;
+}
+
+// Hands the complete frames buffered on c to the workers. A batch ends where
+// the requests switch between queries and mutations, so the queries in front
+// of a place/fire still share the office lock with other connections.
+// Returns -1 on a malformed frame.
+static int connection_dispatch(struct connection* c) {
+	if(c->busy || server.stopping || c->out.len - c->out_off >= HIGH_WATER){
+		return 0;
+	}
+
+	size_t off = c->in_off;
+	size_t n_requests = 0;
+	int has_mutation = 0;
+	while(n_requests < BATCH_MAX && c->in.len - off >= 4){
+		uint32_t len = office_get_u32(c->in.data + off);
+		if(len < 5 || len > OFFICE_REQUEST_MAX - 4){
+			return -1;
+		}
+		if(c->in.len - off - 4 < len){
+			break;
+		}
+		uint8_t op = c->in.data[off + 8];
+		int is_mutation = op == OFFICE_OP_PLACE || op == OFFICE_OP_FIRE;
+		if(n_requests > 0 && is_mutation != has_mutation){
+			break;
+		}
+		has_mutation = is_mutation;
+		off += 4 + len;
+		n_requests++;
+	}
+	if(n_requests == 0){
+		return 0;
+	}
+
+	struct job* job = calloc(1, sizeof(struct job));
+	job->conn = c;
+	job->has_mutation = has_mutation;
+	buffer_append(&job->requests, c->in.data + c->in_off, off - c->in_off);
+	c->in_off = off;
+	c->busy = 1;
+
+	pthread_mutex_lock(&server.pending_mutex);
+	job_list_push(&server.pending, job);
+	pthread_cond_signal(&server.pending_cond);
+	pthread_mutex_unlock(&server.pending_mutex);
+	return 0;
+}
+
+static int connection_has_frame(const struct connection* c) {
+	size_t buffered = c->in.len - c->in_off;
+	return buffered >= 4 && buffered - 4 >= office_get_u32(c->in.data + c->in_off);
+}
+
+// A peer that shut down its sending side still gets every response to the
+// whole frames it sent before the connection is closed.
+static int connection_finished(const struct connection* c) {
+	return c->eof && !c->busy && c->out_off == c->out.len && !connection_has_frame(c);
+}
+
+static void connection_event(struct connection* c, uint32_t events) {
+	// EPOLLHUP means the peer closed both directions, so nothing more can be
+	// delivered. A half close (shutdown(SHUT_WR)) arrives as EPOLLRDHUP.
+	if(events & (EPOLLERR | EPOLLHUP)){
+		connection_close(c);
+		return;
+	}
+	if((events & (EPOLLIN | EPOLLRDHUP)) && !c->eof && connection_read(c) < 0){
+		connection_close(c);
+		return;
+	}
+	if((events & EPOLLOUT) && connection_flush(c) < 0){
+		connection_close(c);
+		return;
+	}
+	if(connection_dispatch(c) < 0 || connection_finished(c)){
+		connection_close(c);
+		return;
+	}
+	connection_update(c);
+}
+
+static void complete_jobs(void) {
+	char drain[256];
+	while(read(server.wake_fd[0], drain, sizeof(drain)) > 0){
+	}
+
+	pthread_mutex_lock(&server.done_mutex);
+	struct job* job = server.done.head;
+	server.done.head = NULL;
+	server.done.tail = NULL;
+	pthread_mutex_unlock(&server.done_mutex);
+
+	while(job != NULL){
+		struct job* next = job->next;
+		struct connection* c = job->conn;
+		c->busy = 0;
+
+		if(c->fd < 0){
+			// The peer left while the batch was running.
+			c->next = server.closed;
+			server.closed = c;
+		}else{
+			buffer_compact(&c->out, &c->out_off);
+			buffer_append(&c->out, job->responses.data, job->responses.len);
+			if(connection_flush(c) < 0 || connection_dispatch(c) < 0 || connection_finished(c)){
+				connection_close(c);
+			}else{
+				connection_update(c);
+			}
+		}
+		job_free(job);
+		job = next;
+	}
+}
+
+static void accept_connections(int listen_fd) {
+	for(;;){
+		int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if(fd < 0){
+			if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+				perror("office_server: accept");
+			}
+			return;
+		}
+
+		struct connection* c = calloc(1, sizeof(struct connection));
+		c->fd = fd;
+		c->events = EPOLLIN | EPOLLRDHUP;
+		struct epoll_event ev = { .events = c->events, .data.ptr = c };
+		if(epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0){
+			perror("office_server: epoll_ctl");
+			close(fd);
+			free(c);
+			continue;
+		}
+
+		c->next = server.connections;
+		if(server.connections != NULL){
+			server.connections->prev = c;
+		}
+		server.connections = c;
+	}
+}
+
+static void free_closed_connections(void) {
+	while(server.closed != NULL){
+		struct connection* c = server.closed;
+		server.closed = c->next;
+		connection_free(c);
+	}
+}
+
+static void handle_stop(int sig) {
+	(void)sig;
+	stop_requested = 1;
+	char c = 0;
+	if(write(server.wake_fd[1], &c, 1) < 0){
+		// Nothing else can be done from a signal handler.
+	}
+}
+
+static int listen_on(const char* path) {
+	struct sockaddr_un addr;
+	if(strlen(path) >= sizeof(addr.sun_path)){
+		fprintf(stderr, "office_server: socket path too long: %s\n", path);
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(fd < 0){
+		perror("office_server: socket");
+		return -1;
+	}
+	unlink(path);
+	if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0){
+		perror("office_server: bind");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void usage(const char* prog) {
+	fprintf(stderr, "usage: %s [-s socket_path] [-w workers]\n", prog);
+}
+
+int main(int argc, char** argv) {
+	const char* path = OFFICE_SOCKET_PATH;
+	long n_workers = sysconf(_SC_NPROCESSORS_ONLN);
+	int opt;
+
+	while((opt = getopt(argc, argv, "s:w:h")) != -1){
+		switch(opt){
+		case 's':
+			path = optarg;
+			break;
+		case 'w':
+			n_workers = strtol(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if(n_workers < 1){
+		n_workers = 1;
+	}
+
+	server.off = malloc(sizeof(struct office));
+	server.off->department_head = NULL;
+	// glibc rwlocks prefer readers by default, which lets a steady stream of
+	// read batches hold off place/fire batches indefinitely.
+	pthread_rwlockattr_t lock_attr;
+	pthread_rwlockattr_init(&lock_attr);
+	pthread_rwlockattr_setkind_np(&lock_attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	pthread_rwlock_init(&server.office_lock, &lock_attr);
+	pthread_rwlockattr_destroy(&lock_attr);
+	pthread_mutex_init(&server.pending_mutex, NULL);
+	pthread_cond_init(&server.pending_cond, NULL);
+	pthread_mutex_init(&server.done_mutex, NULL);
+
+	if(pipe2(server.wake_fd, O_NONBLOCK | O_CLOEXEC) < 0){
+		perror("office_server: pipe");
+		return 1;
+	}
+	int listen_fd = listen_on(path);
+	if(listen_fd < 0){
+		return 1;
+	}
+
+	server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &listen_tag };
+	epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+	ev.data.ptr = &wake_tag;
+	epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.wake_fd[0], &ev);
+
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, handle_stop);
+	signal(SIGTERM, handle_stop);
+
+	pthread_t* workers = malloc(sizeof(pthread_t) * n_workers);
+	for(long i = 0; i < n_workers; i++){
+		pthread_create(&workers[i], NULL, worker_main, NULL);
+	}
+	printf("office_server: listening on %s with %ld workers\n", path, n_workers);
+	fflush(stdout);
+
+	struct epoll_event events[MAX_EVENTS];
+	while(!stop_requested){
+		int n = epoll_wait(server.epoll_fd, events, MAX_EVENTS, -1);
+		if(n < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			perror("office_server: epoll_wait");
+			break;
+		}
+
+		for(int i = 0; i < n; i++){
+			void* tag = events[i].data.ptr;
+			if(tag == &listen_tag){
+				accept_connections(listen_fd);
+			}else if(tag == &wake_tag){
+				complete_jobs();
+			}else{
+				struct connection* c = tag;
+				// Skip connections closed earlier in this iteration.
+				if(c->fd >= 0){
+					connection_event(c, events[i].events);
+				}
+			}
+		}
+		free_closed_connections();
+	}
+
+	// Let the workers drain what they have, then tear everything down.
+	pthread_mutex_lock(&server.pending_mutex);
+	server.stopping = 1;
+	pthread_cond_broadcast(&server.pending_cond);
+	pthread_mutex_unlock(&server.pending_mutex);
+	for(long i = 0; i < n_workers; i++){
+		pthread_join(workers[i], NULL);
+	}
+	free(workers);
+
+	complete_jobs();
+	while(server.connections != NULL){
+		connection_close(server.connections);
+	}
+	free_closed_connections();
+
+	close(listen_fd);
+	unlink(path);
+	close(server.epoll_fd);
+	close(server.wake_fd[0]);
+	close(server.wake_fd[1]);
+	office_disband(server.off);
+	return 0;
+}